@@ -6,6 +6,13 @@
 #include <sys/mman.h>
 #include <unistd.h>
 #include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <ctype.h>
 
 #define NB_SIM 50000
 #define NB_PROCESS 64
@@ -29,8 +36,137 @@ struct res_sim
     double embb_tot;
 };
 
+// Binary columnar result files: a bin_header, nb_columns bin_column descriptors,
+// then appended chunks. A chunk is a bin_chunk followed by each column stored
+// contiguously (nb_rows values of 8 bytes), so every column is 8-byte aligned
+// and can be read in place from a mmap of the file. Native byte order.
+#define BIN_MAGIC "UR3COLS"
+#define BIN_VERSION 1
+#define CHUNK_MAGIC 0x4b4e4843 // "CHNK"
+
+enum bin_kind
+{
+    BIN_SUMMARY = 0, // One chunk with a row per lambda_e, same columns as the CSV
+    BIN_RAW = 1      // One chunk per (lambda_e, G) tried, with a row per replica
+};
+
+enum bin_type
+{
+    COL_I64 = 1,
+    COL_F64 = 2
+};
+
+struct bin_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t kind;
+    uint32_t nb_columns;
+    uint32_t S;
+    uint64_t seed;
+    double lambda_u;
+    double mu;
+    double NbIter;
+    double seuil;
+    uint32_t nb_sim;
+    uint32_t time_spent; // Seconds
+};
+
+struct bin_column
+{
+    char name[16];
+    uint32_t type;
+    uint32_t reserved;
+};
+
+struct bin_chunk
+{
+    uint32_t magic;
+    uint32_t nb_rows;
+    int32_t E; // lambda_e of a raw chunk, -1 for the summary
+    int32_t G; // G of a raw chunk, -1 for the summary
+};
+
+// One line of the report, laid out as NB_REPORT_COLUMNS 8-byte values
+struct report_row
+{
+    int64_t E;
+    double G;
+    double LoadE;
+    double PerG;
+    double loss;
+    double wait_avg;
+    double wait_max;
+    double urllc_tot;
+    double urllc_max;
+    double embb_tot;
+    double horizon;
+};
+
+#define NB_REPORT_COLUMNS 11
+
+// The on-disk layout documented in the README, and the row/column transpose, rely on these sizes
+_Static_assert(sizeof(struct bin_header) == 72, "bin_header must be 72 bytes");
+_Static_assert(sizeof(struct bin_column) == 24, "bin_column must be 24 bytes");
+_Static_assert(sizeof(struct bin_chunk) == 16, "bin_chunk must be 16 bytes");
+_Static_assert(sizeof(struct report_row) == NB_REPORT_COLUMNS * 8, "report_row must be NB_REPORT_COLUMNS packed 8-byte fields");
+
+const struct bin_column report_columns[NB_REPORT_COLUMNS] = {
+    {"E", COL_I64, 0}, {"G", COL_F64, 0}, {"LoadE", COL_F64, 0}, {"PerG", COL_F64, 0}, {"Loss", COL_F64, 0}, {"WaitAvg", COL_F64, 0},
+    {"WaitMax", COL_F64, 0}, {"URLLC_Tot", COL_F64, 0}, {"URLLC_Max", COL_F64, 0}, {"eMBB_Tot", COL_F64, 0}, {"Horizon", COL_F64, 0}};
+
+#define NB_RAW_COLUMNS 6
+const struct bin_column raw_columns[NB_RAW_COLUMNS] = {
+    {"Loss", COL_F64, 0}, {"WaitAvg", COL_F64, 0}, {"WaitMax", COL_F64, 0}, {"URLLC_Tot", COL_F64, 0}, {"URLLC_Max", COL_F64, 0}, {"eMBB_Tot", COL_F64, 0}};
+
+// Per-replica dump shared by the worker processes. Each one fills its own
+// chunk buffer and appends it with a single pwrite at a reserved offset
+struct raw_out
+{
+    int fd;
+    int64_t *offset; // End of the file, in shared memory
+    char *buf;       // bin_chunk followed by NB_RAW_COLUMNS columns of NB_SIM doubles
+    int failed;      // Set once a chunk could not be written, no more chunks are written
+};
+
+// Exit status of a worker whose results are complete but whose raw chunks could not all be written
+#define EXIT_RAW_FAILED 2
+
+enum report_format
+{
+    FORMAT_CSV = 0,
+    FORMAT_BIN = 1
+};
+
+// Scramble a 64-bit value (splitmix64 finalizer)
+uint64_t mix64(uint64_t z)
+{
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// Derive the RNG substream of one replica, so that its draws only depend on
+// (seed, S, lambda_e, G, replica) and not on which process or shard runs it
+uint64_t substream(uint64_t seed, int S, int lambda_e, int G, int replica)
+{
+    uint64_t s = mix64(seed);
+    s = mix64(s ^ (uint64_t)S);
+    s = mix64(s ^ (uint64_t)lambda_e);
+    s = mix64(s ^ (uint64_t)G);
+    s = mix64(s ^ (uint64_t)replica);
+    return s;
+}
+
+// Uniform draw in (0, 1] from a splitmix64 stream
+double uniform(uint64_t *rng)
+{
+    *rng += 0x9e3779b97f4a7c15ULL;
+    return ((mix64(*rng) >> 11) + 1) * 0x1.0p-53;
+}
+
 // Define the transition function
-void transition(double lambda_e, double lambda_u, double mu, int S, double G, int x1, int x2, int x3, double *duree, int etat[3])
+void transition(double lambda_e, double lambda_u, double mu, int S, double G, int x1, int x2, int x3, double *duree, int etat[3], uint64_t *rng)
 {
     int etats[5][3];
     double taux[5];
@@ -94,10 +230,10 @@ void transition(double lambda_e, double lambda_u, double mu, int S, double G, in
         param_expo += taux[i];
     }
 
-    *duree = -1.0 / param_expo * log((double)rand() / RAND_MAX);
+    *duree = -1.0 / param_expo * log(uniform(rng));
 
     double cumulative_sum = 0.0;
-    double u = (double)rand() / RAND_MAX;
+    double u = uniform(rng);
     int index = 0;
     for (int i = 0; i < count; i++)
     {
@@ -114,7 +250,7 @@ void transition(double lambda_e, double lambda_u, double mu, int S, double G, in
     etat[2] = etats[index][2];
 }
 
-void simu(double lambda_e, double lambda_u, double mu, int S, double G, double NbIter, struct res_sim *res)
+void simu(double lambda_e, double lambda_u, double mu, int S, double G, double NbIter, struct res_sim *res, uint64_t *rng)
 {
     int e[3] = {0, 0, 0};
     double cumul = 0.0;
@@ -131,7 +267,7 @@ void simu(double lambda_e, double lambda_u, double mu, int S, double G, double N
     {
         t = 0.0;
         int e_new[3] = {0, 0, 0};
-        transition(lambda_e, lambda_u, mu, S, G, e[0], e[1], e[2], &t, e_new);
+        transition(lambda_e, lambda_u, mu, S, G, e[0], e[1], e[2], &t, e_new, rng);
         temps_total += t;
         wait_avg += e[2] * t;
         wait_max = (wait_max > e[2]) ? wait_max : e[2];
@@ -189,53 +325,578 @@ void show_progress_bar(int completed, int total)
     fflush(stdout);
 }
 
-int valeur_canaux_garde_1(double lambda_e, double lambda_u, double mu, int S, double NbIter, double seuil, struct res_sim *res_mean)
+// Write the whole buffer at the given offset of fd
+int write_all(int fd, const void *buf, size_t size, int64_t offset)
+{
+    const char *p = buf;
+    while (size > 0)
+    {
+        ssize_t n = pwrite(fd, p, size, offset);
+        if (n < 0)
+        {
+            perror("write failed");
+            return 1;
+        }
+        p += n;
+        size -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+// Write the header and column descriptors at the start of a binary result file
+int write_bin_header(int fd, uint32_t kind, const struct bin_column *columns, int nb_columns, int S, uint64_t seed, double time_spent)
+{
+    struct bin_header header = {BIN_MAGIC, BIN_VERSION, kind, nb_columns, S, seed, lambda_u, mu, NbIter, seuil, NB_SIM, (uint32_t)time_spent};
+    if (write_all(fd, &header, sizeof(header), 0))
+    {
+        return 1;
+    }
+    return write_all(fd, columns, nb_columns * sizeof(struct bin_column), sizeof(header));
+}
+
+// Append the replicas buffered in raw as the chunk of (E, G)
+int write_raw_chunk(struct raw_out *raw, int E, int G)
+{
+    if (raw->failed)
+    {
+        return 1;
+    }
+
+    size_t size = sizeof(struct bin_chunk) + NB_RAW_COLUMNS * NB_SIM * sizeof(double);
+    *(struct bin_chunk *)raw->buf = (struct bin_chunk){CHUNK_MAGIC, NB_SIM, E, G};
+    int64_t offset = __sync_fetch_and_add(raw->offset, (int64_t)size); // Reserve room atomically
+    raw->failed = write_all(raw->fd, raw->buf, size, offset);
+    return raw->failed;
+}
+
+// Search the smallest G whose mean loss is below seuil. The per-replica sums
+// of the last G tried are left in res_sum (divide by NB_SIM to get the means)
+// When raw is not NULL, the replicas of every G tried are appended to it as a chunk
+int valeur_canaux_garde_1(double lambda_e, double lambda_u, double mu, int S, double NbIter, double seuil, uint64_t seed, struct res_sim *res_sum, struct raw_out *raw)
 {
     int G = -1;
     double a = 1.0;
+    double *cols = (raw != NULL) ? (double *)(raw->buf + sizeof(struct bin_chunk)) : NULL;
 
     while (a > seuil)
     {
         G++;
-        *res_mean = (struct res_sim){0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+        *res_sum = (struct res_sim){0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
 
         for (int i = 0; i < NB_SIM; i++)
         {
             struct res_sim res;
-            simu(lambda_e, lambda_u, mu, S, G, NbIter, &res);
-            res_mean->loss += res.loss;
-            res_mean->wait_avg += res.wait_avg;
-            res_mean->wait_max += res.wait_max;
-            res_mean->urllc_tot += res.urllc_tot;
-            res_mean->urllc_max += res.urllc_max;
-            res_mean->embb_tot += res.embb_tot;
+            uint64_t rng = substream(seed, S, (int)lambda_e, G, i);
+            simu(lambda_e, lambda_u, mu, S, G, NbIter, &res, &rng);
+            res_sum->loss += res.loss;
+            res_sum->wait_avg += res.wait_avg;
+            res_sum->wait_max += res.wait_max;
+            res_sum->urllc_tot += res.urllc_tot;
+            res_sum->urllc_max += res.urllc_max;
+            res_sum->embb_tot += res.embb_tot;
+
+            if (raw != NULL)
+            {
+                cols[0 * NB_SIM + i] = res.loss;
+                cols[1 * NB_SIM + i] = res.wait_avg;
+                cols[2 * NB_SIM + i] = res.wait_max;
+                cols[3 * NB_SIM + i] = res.urllc_tot;
+                cols[4 * NB_SIM + i] = res.urllc_max;
+                cols[5 * NB_SIM + i] = res.embb_tot;
+            }
         }
 
-        res_mean->loss /= (double)NB_SIM;
-        res_mean->wait_avg /= (double)NB_SIM;
-        res_mean->wait_max /= (double)NB_SIM;
-        res_mean->urllc_tot /= (double)NB_SIM;
-        res_mean->urllc_max /= (double)NB_SIM;
-        res_mean->embb_tot /= (double)NB_SIM;
+        if (raw != NULL)
+        {
+            write_raw_chunk(raw, (int)lambda_e, G);
+        }
 
-        a = res_mean->loss;
+        a = res_sum->loss / (double)NB_SIM;
     }
 
     return G;
 }
 
+// Compute the report line of every lambda_e from the G values and replica sums
+void build_report(int S, const double *R, const struct res_sim *res_sum, struct report_row *rows)
+{
+    for (int i = START; i <= END; i += STEP)
+    {
+        int index = (i - START) / STEP;
+        struct report_row *row = &rows[index];
+        row->E = i;
+        row->G = R[index];                              // Get the value of G from shared memory
+        row->LoadE = i / (mu * ((double)(S - row->G))); // Calculate LoadE as E/mu*(S-G)
+        row->PerG = (row->G / (double)S) * 100.0;       // Calculate PerG as (G/S)*100
+        row->horizon = NbIter / (i + lambda_u);         // Calculate Horizon
+
+        // Average the replica sums of the res_sim struct
+        row->loss = res_sum[index].loss / (double)NB_SIM;
+        row->wait_avg = res_sum[index].wait_avg / (double)NB_SIM;
+        row->wait_max = res_sum[index].wait_max / (double)NB_SIM;
+        row->urllc_tot = res_sum[index].urllc_tot / (double)NB_SIM;
+        row->urllc_max = res_sum[index].urllc_max / (double)NB_SIM;
+        row->embb_tot = res_sum[index].embb_tot / (double)NB_SIM;
+    }
+}
+
+// Write the report rows to S(<S>).csv
+int write_csv(int S, const struct report_row *rows, int nb_rows, double time_spent)
+{
+    // File name based on the value of S
+    char filename[50];
+    sprintf(filename, "S(%d).csv", S);
+
+    // Open the CSV file for writing
+    FILE *file = fopen(filename, "w");
+    if (file == NULL)
+    {
+        printf("Error opening file!\n");
+        return 1;
+    }
+
+    // Convert time spent to hours, minutes, and seconds
+    int hours = (int)time_spent / 3600;
+    int minutes = ((int)time_spent % 3600) / 60;
+    int seconds = (int)time_spent % 60;
+
+    // Write the header for the CSV file
+    fprintf(file, "E;G;LoadE;PerG;Loss;WaitAvg;WaitMax;URLLC_Tot;URLLC_Max;eMBB_Tot;Horizon;;# %d hrs %d mins %d s\n", hours, minutes, seconds);
+
+    for (int r = 0; r < nb_rows; r++)
+    {
+        const struct report_row *row = &rows[r];
+        fprintf(file, "%d;%f;%f;%f;%f;%f;%f;%f;%f;%f;%f;\n", (int)row->E, row->G, row->LoadE, row->PerG, row->loss, row->wait_avg, row->wait_max,
+                row->urllc_tot, row->urllc_max, row->embb_tot, row->horizon);
+    }
+
+    printf("Time: %d hrs %d mins %d s\n", hours, minutes, seconds);
+
+    // Close the CSV file
+    int failed = ferror(file);
+    failed |= fclose(file) != 0;
+    if (failed)
+    {
+        printf("Error writing %s!\n", filename);
+        return 1;
+    }
+
+    return 0;
+}
+
+// Write the report rows to S(<S>).bin as a single summary chunk
+int write_bin(int S, uint64_t seed, const struct report_row *rows, int nb_rows, double time_spent)
+{
+    char filename[50];
+    sprintf(filename, "S(%d).bin", S);
+
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        printf("Error opening file!\n");
+        return 1;
+    }
+
+    // Transpose the rows into columns behind the chunk header
+    size_t size = sizeof(struct bin_chunk) + NB_REPORT_COLUMNS * nb_rows * sizeof(double);
+    char *buf = malloc(size);
+    if (buf == NULL)
+    {
+        perror("malloc failed");
+        close(fd);
+        return 1;
+    }
+    *(struct bin_chunk *)buf = (struct bin_chunk){CHUNK_MAGIC, nb_rows, -1, -1};
+    char *cols = buf + sizeof(struct bin_chunk);
+    for (int c = 0; c < NB_REPORT_COLUMNS; c++)
+    {
+        for (int r = 0; r < nb_rows; r++)
+        {
+            memcpy(cols + (c * nb_rows + r) * 8, (const char *)&rows[r] + c * 8, 8);
+        }
+    }
+
+    int64_t offset = sizeof(struct bin_header) + NB_REPORT_COLUMNS * sizeof(struct bin_column);
+    int ret = write_bin_header(fd, BIN_SUMMARY, report_columns, NB_REPORT_COLUMNS, S, seed, time_spent) || write_all(fd, buf, size, offset);
+
+    free(buf);
+    ret |= close(fd) != 0;
+    if (ret)
+    {
+        printf("Error writing %s!\n", filename);
+    }
+
+    int t = (int)time_spent;
+    printf("Time: %d hrs %d mins %d s\n", t / 3600, (t % 3600) / 60, t % 60);
+
+    return ret;
+}
+
+int write_report(int S, uint64_t seed, const double *R, const struct res_sim *res_sum, double time_spent, int format)
+{
+    int num_steps = (END - START) / STEP + 1;
+    struct report_row rows[num_steps];
+    build_report(S, R, res_sum, rows);
+
+    if (format == FORMAT_BIN)
+    {
+        return write_bin(S, seed, rows, num_steps, time_spent);
+    }
+    return write_csv(S, rows, num_steps, time_spent);
+}
+
+// Convert a summary file written with --format bin back to S(<S>).csv
+int export_csv(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0)
+    {
+        printf("Error opening %s!\n", path);
+        return 1;
+    }
+
+    size_t data = sizeof(struct bin_header) + NB_REPORT_COLUMNS * sizeof(struct bin_column);
+    if ((size_t)st.st_size < data + sizeof(struct bin_chunk))
+    {
+        printf("%s: not a summary file\n", path);
+        close(fd);
+        return 1;
+    }
+
+    char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        perror("mmap failed");
+        return 1;
+    }
+
+    const struct bin_header *header = (const struct bin_header *)map;
+    const struct bin_chunk *chunk = (const struct bin_chunk *)(map + data);
+    int ok = memcmp(header->magic, BIN_MAGIC, sizeof(header->magic)) == 0 && header->version == BIN_VERSION && header->kind == BIN_SUMMARY &&
+             header->nb_columns == NB_REPORT_COLUMNS &&
+             memcmp(map + sizeof(struct bin_header), report_columns, sizeof(report_columns)) == 0 && chunk->magic == CHUNK_MAGIC && chunk->nb_rows > 0 &&
+             (size_t)st.st_size >= data + sizeof(struct bin_chunk) + (size_t)NB_REPORT_COLUMNS * chunk->nb_rows * sizeof(double);
+    if (!ok)
+    {
+        printf("%s: not a summary file\n", path);
+        munmap(map, st.st_size);
+        return 1;
+    }
+
+    // Gather the mapped columns back into rows
+    int nb_rows = chunk->nb_rows;
+    const char *cols = (const char *)(chunk + 1);
+    struct report_row *rows = malloc(nb_rows * sizeof(struct report_row));
+    if (rows == NULL)
+    {
+        perror("malloc failed");
+        munmap(map, st.st_size);
+        return 1;
+    }
+    for (int c = 0; c < NB_REPORT_COLUMNS; c++)
+    {
+        for (int r = 0; r < nb_rows; r++)
+        {
+            memcpy((char *)&rows[r] + c * 8, cols + (c * nb_rows + r) * 8, 8);
+        }
+    }
+
+    int ret = write_csv(header->S, rows, nb_rows, header->time_spent);
+
+    free(rows);
+    munmap(map, st.st_size);
+
+    return ret;
+}
+
+// Write the partial result file of one shard. Doubles are printed in hex (%a)
+// so that merging gives back the exact bits of an unsharded run
+int write_partial(int S, uint64_t seed, int shard_id, int shard_count, const double *R, const struct res_sim *res_sum, double time_spent)
+{
+    char filename[80];
+    sprintf(filename, "S(%d).shard%dof%d.part", S, shard_id, shard_count);
+
+    FILE *file = fopen(filename, "w");
+    if (file == NULL)
+    {
+        printf("Error opening file!\n");
+        return 1;
+    }
+
+    fprintf(file, "UR3-PART S=%d seed=%" PRIu64 " shard=%d/%d lambda_u=%d mu=%a NbIter=%a seuil=%a NB_SIM=%d START=%d END=%d STEP=%d time=%d\n",
+            S, seed, shard_id, shard_count, lambda_u, mu, NbIter, seuil, NB_SIM, START, END, STEP, (int)time_spent);
+
+    int num_steps = (END - START) / STEP + 1;
+    for (int index = shard_id; index < num_steps; index += shard_count)
+    {
+        fprintf(file, "%d %a %a %a %a %a %a %a\n", index, R[index], res_sum[index].loss, res_sum[index].wait_avg, res_sum[index].wait_max,
+                res_sum[index].urllc_tot, res_sum[index].urllc_max, res_sum[index].embb_tot);
+    }
+
+    // This file is the only output of a shard, a short write must not pass for success
+    int failed = ferror(file);
+    failed |= fclose(file) != 0;
+    if (failed)
+    {
+        printf("Error writing %s!\n", filename);
+        return 1;
+    }
+    printf("Partial results written to %s\n", filename);
+
+    return 0;
+}
+
+// Combine the partial files of every shard of one sweep into S(<S>).csv
+int merge(int nb_files, char *files[], int format)
+{
+    if (nb_files < 1)
+    {
+        printf("Usage: merge <partial files...>\n");
+        return 1;
+    }
+
+    int num_steps = (END - START) / STEP + 1;
+    double R[num_steps];
+    struct res_sim res_sum[num_steps];
+    int filled[num_steps];
+    memset(filled, 0, sizeof(filled));
+
+    int S = 0, shard_count = 0, max_time = 0;
+    uint64_t seed = 0;
+    int *seen = NULL;
+
+    for (int f = 0; f < nb_files; f++)
+    {
+        FILE *file = fopen(files[f], "r");
+        if (file == NULL)
+        {
+            printf("Error opening %s!\n", files[f]);
+            free(seen);
+            return 1;
+        }
+
+        int s, id, count, l_u, nb_sim, start, end, step, time_spent;
+        uint64_t sd;
+        double m, nb_iter, threshold;
+        char eol;
+        int ok = fscanf(file, "UR3-PART S=%d seed=%" SCNu64 " shard=%d/%d lambda_u=%d mu=%la NbIter=%la seuil=%la NB_SIM=%d START=%d END=%d STEP=%d time=%d%c",
+                        &s, &sd, &id, &count, &l_u, &m, &nb_iter, &threshold, &nb_sim, &start, &end, &step, &time_spent, &eol) == 14 &&
+                 eol == '\n';
+
+        // Every shard must come from this binary's parameters and share S, seed and shard count
+        if (!ok || count < 1 || l_u != lambda_u || m != mu || nb_iter != NbIter || threshold != seuil || nb_sim != NB_SIM || start != START || end != END || step != STEP)
+        {
+            printf("%s: not a partial file of this sweep\n", files[f]);
+            fclose(file);
+            free(seen);
+            return 1;
+        }
+        if (f == 0)
+        {
+            S = s;
+            seed = sd;
+            shard_count = count;
+            seen = calloc(shard_count, sizeof(int));
+            if (seen == NULL)
+            {
+                perror("calloc failed");
+                fclose(file);
+                return 1;
+            }
+        }
+        if (s != S || sd != seed || count != shard_count || id < 0 || id >= shard_count || seen[id])
+        {
+            printf("%s: shard %d/%d (S=%d, seed=%" PRIu64 ") does not match the other files\n", files[f], id, count, s, sd);
+            fclose(file);
+            free(seen);
+            return 1;
+        }
+        seen[id] = 1;
+        max_time = (max_time > time_spent) ? max_time : time_spent;
+
+        // Every row must end with a newline, so that a file cut inside its last value is not read as a shorter value
+        int index, n;
+        struct res_sim r;
+        double G;
+        while ((n = fscanf(file, "%d %la %la %la %la %la %la %la%c", &index, &G, &r.loss, &r.wait_avg, &r.wait_max, &r.urllc_tot, &r.urllc_max, &r.embb_tot, &eol)) == 9 &&
+               eol == '\n')
+        {
+            if (index < 0 || index >= num_steps || index % shard_count != id)
+            {
+                printf("%s: unexpected row %d\n", files[f], index);
+                fclose(file);
+                free(seen);
+                return 1;
+            }
+            R[index] = G;
+            res_sum[index] = r;
+            filled[index] = 1;
+        }
+        if (n != EOF || ferror(file))
+        {
+            printf("%s: truncated or malformed partial file\n", files[f]);
+            fclose(file);
+            free(seen);
+            return 1;
+        }
+        fclose(file);
+    }
+
+    free(seen);
+
+    if (nb_files != shard_count)
+    {
+        printf("Expected %d partial files, got %d\n", shard_count, nb_files);
+        return 1;
+    }
+    for (int index = 0; index < num_steps; index++)
+    {
+        if (!filled[index])
+        {
+            printf("Missing result for E=%d\n", START + index * STEP);
+            return 1;
+        }
+    }
+
+    // Shards run side by side, so the slowest one gives the wall-clock time
+    return write_report(S, seed, R, res_sum, max_time, format);
+}
+
+void usage(const char *prog)
+{
+    printf("Usage: %s <S> [--seed <n>] [--shard <i>/<N>] [--format csv|bin] [--raw]\n", prog);
+    printf("       %s merge [--format csv|bin] <partial files...>\n", prog);
+    printf("       %s export <S(<S>).bin>\n", prog);
+    printf("--format selects the final report, so with --shard it must be given to merge instead\n");
+}
+
 // Main function to run the simulation
 int main(int argc, char *argv[])
 {
-    if (argc < 2)
+    uint64_t seed = (uint64_t)time(NULL);
+    int has_seed = 0;
+    int shard_id = 0;
+    int shard_count = 1;
+    int sharded = 0;
+    int format = FORMAT_CSV;
+    int has_format = 0;
+    int raw_dump = 0;
+
+    int c;
+    while (1)
+    {
+        static struct option long_options[] = {
+            {"seed", required_argument, 0, 's'},
+            {"shard", required_argument, 0, 'h'},
+            {"format", required_argument, 0, 'f'},
+            {"raw", no_argument, 0, 'r'},
+            {0, 0, 0, 0}};
+
+        int option_index = 0;
+        c = getopt_long(argc, argv, "s:h:f:r", long_options, &option_index);
+
+        if (c == -1)
+            break;
+
+        switch (c)
+        {
+        case 's':
+        {
+            // Runs are reproduced from the seed, so only take a plain decimal number
+            char *end;
+            errno = 0;
+            seed = strtoull(optarg, &end, 10);
+            if (!isdigit((unsigned char)optarg[0]) || *end != '\0' || errno != 0)
+            {
+                printf("Invalid seed '%s', expected a decimal number\n", optarg);
+                return 1;
+            }
+            has_seed = 1;
+            break;
+        }
+        case 'h':
+        {
+            int len = 0;
+            if (sscanf(optarg, "%d/%d%n", &shard_id, &shard_count, &len) != 2 || optarg[len] != '\0' || shard_count < 1 || shard_id < 0 ||
+                shard_id >= shard_count)
+            {
+                printf("Invalid shard '%s', expected <i>/<N> with 0 <= i < N\n", optarg);
+                return 1;
+            }
+            sharded = 1;
+            break;
+        }
+        case 'f':
+            if (strcmp(optarg, "csv") == 0)
+                format = FORMAT_CSV;
+            else if (strcmp(optarg, "bin") == 0)
+                format = FORMAT_BIN;
+            else
+            {
+                printf("Invalid format '%s', expected csv or bin\n", optarg);
+                return 1;
+            }
+            has_format = 1;
+            break;
+        case 'r':
+            raw_dump = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (optind >= argc)
     {
         printf("One arg is required!\n");
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (strcmp(argv[optind], "merge") == 0)
+    {
+        // The shards already ran, only the report format can still be chosen
+        if (has_seed || sharded || raw_dump)
+        {
+            printf("merge only accepts --format\n");
+            return 1;
+        }
+        return merge(argc - optind - 1, argv + optind + 1, format);
+    }
+    if (strcmp(argv[optind], "export") == 0)
+    {
+        if (optind + 1 >= argc)
+        {
+            usage(argv[0]);
+            return 1;
+        }
+        if (has_seed || sharded || raw_dump || has_format)
+        {
+            printf("export takes no option\n");
+            return 1;
+        }
+        return export_csv(argv[optind + 1]);
+    }
+
+    // All the shards of a sweep must draw from the same substreams
+    if (sharded && !has_seed)
+    {
+        printf("--shard requires --seed\n");
         return 1;
     }
 
-    srand(time(NULL));
+    // A shard only writes a partial file, the report is written by merge
+    if (sharded && has_format)
+    {
+        printf("--format does not apply to --shard, give it to merge\n");
+        return 1;
+    }
 
-    int S = atoi(argv[1]); // Get value of S from command-line argument
+    int S = atoi(argv[optind]); // Get value of S from command-line argument
 
     time_t start_time, end_time;
     double time_spent;
@@ -248,10 +909,18 @@ int main(int argc, char *argv[])
     printf("S: %d\n", S);
     printf("Number of iterations: %.2f\n", NbIter);
     printf("Loss limit: %.5f\n", seuil);
+    printf("Seed: %" PRIu64 "\n", seed);
+    if (sharded)
+    {
+        printf("Shard: %d/%d\n", shard_id, shard_count);
+    }
 
     // Calculate the number of steps
     int num_steps = (END - START) / STEP + 1;
 
+    // This shard handles every shard_count-th lambda_e, starting at shard_id
+    int shard_steps = (num_steps - shard_id + shard_count - 1) / shard_count;
+
     // Allocate memory for results, but only for STEP-th values
     double *R = mmap(NULL, num_steps * sizeof(double), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
     struct res_sim *res = mmap(NULL, num_steps * sizeof(struct res_sim), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
@@ -265,110 +934,148 @@ int main(int argc, char *argv[])
 
     *progress = 0; // Initialize progress counter
 
-    show_progress_bar(0, num_steps);
+    // Open the per-replica dump, its chunks are appended by the child processes
+    struct raw_out raw = {-1, NULL, NULL, 0};
+    char raw_filename[80];
+    if (raw_dump)
+    {
+        if (sharded)
+            sprintf(raw_filename, "S(%d).shard%dof%d.raw.bin", S, shard_id, shard_count);
+        else
+            sprintf(raw_filename, "S(%d).raw.bin", S);
+
+        raw.fd = open(raw_filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        raw.offset = mmap(NULL, sizeof(int64_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (raw.fd < 0 || raw.offset == MAP_FAILED || write_bin_header(raw.fd, BIN_RAW, raw_columns, NB_RAW_COLUMNS, S, seed, 0))
+        {
+            printf("Error opening %s!\n", raw_filename);
+            return 1;
+        }
+        *raw.offset = sizeof(struct bin_header) + NB_RAW_COLUMNS * sizeof(struct bin_column);
+    }
+
+    show_progress_bar(0, shard_steps);
 
     double horizon[num_steps];
 
+    int running = 0;
+    int workers_failed = 0;
+    int raw_failed = 0;
+
     // Fork processes and do work in parallel
     for (int p = 0; p < NB_PROCESS; p++)
     {
         pid_t pid = fork();
 
+        if (pid < 0)
+        {
+            // The work of the missing children is never done, only wait for those already started
+            perror("fork failed");
+            workers_failed = 1;
+            break;
+        }
+
         if (pid == 0)
         { // Child process
-            for (int i = START + p * STEP; i <= END; i += NB_PROCESS * STEP)
+            if (raw_dump)
+            {
+                raw.buf = malloc(sizeof(struct bin_chunk) + NB_RAW_COLUMNS * NB_SIM * sizeof(double));
+                if (raw.buf == NULL)
+                {
+                    perror("malloc failed");
+                    exit(1);
+                }
+            }
+
+            for (int k = p; k < shard_steps; k += NB_PROCESS)
             {
-                int index = (i - START) / STEP; // Calculate the index in the reduced array
+                int index = shard_id + k * shard_count; // Calculate the index in the reduced array
+                int i = START + index * STEP;
                 double lambda_e = i * 1.0;
                 horizon[index] = NbIter / (lambda_e + lambda_u);
 
                 struct res_sim res_temp = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
-                R[index] = valeur_canaux_garde_1(lambda_e, lambda_u, mu, S, NbIter, seuil, &res_temp);
+                R[index] = valeur_canaux_garde_1(lambda_e, lambda_u, mu, S, NbIter, seuil, seed, &res_temp, raw_dump ? &raw : NULL);
                 res[index] = res_temp;
 
                 __sync_fetch_and_add(progress, 1); // Atomically increment progress
-                printf("E=%d, G=%f, L=%f, U=%f, T=%f, B=%f, A=%f, M=%f, H=%f,\n", i, R[index], res[index].loss, res[index].urllc_tot, res[index].urllc_max, res[index].embb_tot, res[index].wait_avg, res[index].wait_max, horizon[index]);
+                printf("E=%d, G=%f, L=%f, U=%f, T=%f, B=%f, A=%f, M=%f, H=%f,\n", i, R[index], res[index].loss / NB_SIM, res[index].urllc_tot / NB_SIM, res[index].urllc_max / NB_SIM,
+                       res[index].embb_tot / NB_SIM, res[index].wait_avg / NB_SIM, res[index].wait_max / NB_SIM, horizon[index]);
             }
 
             // Child process exits after its work is done
-            exit(0);
+            free(raw.buf);
+            exit(raw.failed ? EXIT_RAW_FAILED : 0);
         }
+
+        running++;
     }
 
+    // Reap the children while showing progress, so that a child dying early does not block the parent
     int prev_progress = 0;
-    while (prev_progress < num_steps)
+    while (running > 0)
     {
         usleep(100000); // Sleep for a short time (100ms)
+
+        int status;
+        while (waitpid(-1, &status, WNOHANG) > 0)
+        {
+            running--;
+            if (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_RAW_FAILED)
+                raw_failed = 1;
+            else if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+                workers_failed = 1;
+        }
+
         if (*progress != prev_progress)
         {
             prev_progress = *progress;
-            show_progress_bar(prev_progress, num_steps); // Update progress bar
+            show_progress_bar(prev_progress, shard_steps); // Update progress bar
         }
     }
 
     printf("\n");
 
-    // Parent process waits for all children to finish
-    for (int p = 0; p < NB_PROCESS; p++)
-    {
-        wait(NULL);
-    }
-
     // Record the end time
     end_time = time(NULL);
     time_spent = difftime(end_time, start_time);
 
-    // File name based on the value of S
-    char filename[50];
-    sprintf(filename, "S(%d).csv", S);
-
-    // Open the CSV file for writing
-    FILE *file = fopen(filename, "w");
-    if (file == NULL)
+    int ret;
+    if (workers_failed)
     {
-        printf("Error opening file!\n");
-        return 1;
+        printf("A worker process failed, results are incomplete\n");
+        ret = 1;
     }
-
-    // Convert time spent to hours, minutes, and seconds
-    int hours = (int)time_spent / 3600;
-    int minutes = ((int)time_spent % 3600) / 60;
-    int seconds = (int)time_spent % 60;
-
-    // Write the header for the CSV file
-    fprintf(file, "E;G;LoadE;PerG;Loss;WaitAvg;WaitMax;URLLC_Tot;URLLC_Max;eMBB_Tot;Horizon;;# %d hrs %d mins %d s\n", hours, minutes, seconds);
-    fflush(file);
-
-    for (int i = START; i <= END; i += STEP)
+    else if (sharded)
     {
-        int index = (i - START) / STEP;
-        double G = R[index];                         // Get the value of G from shared memory
-        double LoadE = i / (mu * ((double)(S - G))); // Calculate LoadE as E/mu*(S-G)
-        double PerG = (G / (double)S) * 100.0;       // Calculate PerG as (G/S)*100
-        double horizon = NbIter / (i + lambda_u);    // Calculate Horizon
-
-        // Extract values from the res_sim struct
-        double loss = res[index].loss;
-        double wait_avg = res[index].wait_avg;
-        double wait_max = res[index].wait_max;
-        double urllc_tot = res[index].urllc_tot;
-        double urllc_max = res[index].urllc_max;
-        double embb_tot = res[index].embb_tot;
-
-        // Write all the values to the file
-        fprintf(file, "%d;%f;%f;%f;%f;%f;%f;%f;%f;%f;%f;\n", i, G, LoadE, PerG, loss, wait_avg, wait_max, urllc_tot, urllc_max, embb_tot, horizon);
-        fflush(file); // Ensure the data is written to the file
+        ret = write_partial(S, seed, shard_id, shard_count, R, res, time_spent);
+    }
+    else
+    {
+        ret = write_report(S, seed, R, res, time_spent, format);
     }
 
-    printf("Time: %d hrs %d mins %d s\n", hours, minutes, seconds);
-
-    // Close the CSV file
-    fclose(file);
+    if (raw_dump)
+    {
+        // Now that the run is over, record its duration in the dump header
+        raw_failed |= write_bin_header(raw.fd, BIN_RAW, raw_columns, NB_RAW_COLUMNS, S, seed, time_spent);
+        raw_failed |= close(raw.fd) != 0;
+        munmap(raw.offset, sizeof(int64_t));
+        if (raw_failed || workers_failed)
+        {
+            printf("Error writing %s, replica results are incomplete\n", raw_filename);
+            ret = 1;
+        }
+        else
+        {
+            printf("Replica results written to %s\n", raw_filename);
+        }
+    }
 
     // Clean up shared memory
     munmap(R, num_steps * sizeof(double));
     munmap(res, num_steps * sizeof(struct res_sim));
     munmap(progress, sizeof(int));
 
-    return 0;
+    return ret;
 }